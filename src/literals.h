@@ -0,0 +1,294 @@
+#ifndef REGEX_MATCHER_LITERALS_H
+#define REGEX_MATCHER_LITERALS_H
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ast.h"
+
+namespace {
+    using Literals = std::vector<std::string>;
+
+    // Sets growing past this size are not worth prefiltering on
+    const size_t max_literals = 64;
+    // Sets up to this size use the packed searcher, larger ones Aho-Corasick
+    const size_t max_packed_literals = 8;
+
+    class LiteralSearcher {
+    public:
+        LiteralSearcher(Literals literals_) : literals{std::move(literals_)} {
+            for (auto &literal: literals) {
+                max_length = std::max(max_length, literal.size());
+            }
+            if (literals.size() > max_packed_literals) {
+                build_automaton();
+            }
+        };
+
+        // Start of the leftmost occurrence of any literal in [begin, end), or end if there is none
+        const char *find(const char *begin, const char *end) const {
+            return literals.size() > max_packed_literals ? find_automaton(begin, end) : find_packed(begin, end);
+        }
+
+        const Literals &get_literals() const { return literals; }
+
+    private:
+        bool match_at(const char *position, const char *end) const {
+            for (auto &literal: literals) {
+                if ((size_t) (end - position) >= literal.size() &&
+                    std::memcmp(position, literal.data(), literal.size()) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Compares the first two bytes of every literal against 16 positions at a time, then verifies candidates
+        const char *find_packed(const char *begin, const char *end) const {
+            auto current = begin;
+#if defined(__SSE2__)
+            for (; end - current >= 17; current += 16) {
+                auto first = _mm_loadu_si128((const __m128i *) current);
+                auto second = _mm_loadu_si128((const __m128i *) (current + 1));
+                auto candidates = _mm_setzero_si128();
+                for (auto &literal: literals) {
+                    auto hits = _mm_cmpeq_epi8(first, _mm_set1_epi8(literal[0]));
+                    if (literal.size() > 1) {
+                        hits = _mm_and_si128(hits, _mm_cmpeq_epi8(second, _mm_set1_epi8(literal[1])));
+                    }
+                    candidates = _mm_or_si128(candidates, hits);
+                }
+                for (auto mask = (unsigned) _mm_movemask_epi8(candidates); mask; mask &= mask - 1) {
+                    auto position = current + __builtin_ctz(mask);
+                    if (match_at(position, end)) {
+                        return position;
+                    }
+                }
+            }
+#endif
+            for (; current != end; ++current) {
+                if (match_at(current, end)) {
+                    return current;
+                }
+            }
+            return end;
+        }
+
+        void build_automaton() {
+            // Bytes not appearing in any literal share class 0
+            std::fill(byte_classes.begin(), byte_classes.end(), 0);
+            for (auto &literal: literals) {
+                for (auto c: literal) {
+                    auto &byte_class = byte_classes[(unsigned char) c];
+                    if (byte_class == 0) {
+                        byte_class = ++class_count;
+                    }
+                }
+            }
+            ++class_count;
+
+            // Trie, with 0 as the root and -1 as a missing edge
+            transitions.assign(class_count, -1);
+            longest_output.assign(1, 0);
+            for (auto &literal: literals) {
+                long state = 0;
+                for (auto c: literal) {
+                    auto &next = transitions[state * class_count + byte_classes[(unsigned char) c]];
+                    if (next == -1) {
+                        next = longest_output.size();
+                        longest_output.push_back(0);
+                        transitions.resize(transitions.size() + class_count, -1);
+                    }
+                    state = transitions[state * class_count + byte_classes[(unsigned char) c]];
+                }
+                longest_output[state] = literal.size();
+            }
+
+            // Breadth first, fold failure links into a full transition table
+            std::vector<long> failure(longest_output.size(), 0);
+            std::vector<long> queue;
+            for (long byte_class = 0; byte_class < class_count; ++byte_class) {
+                auto &next = transitions[byte_class];
+                if (next == -1) {
+                    next = 0;
+                } else {
+                    queue.push_back(next);
+                }
+            }
+            for (size_t i = 0; i < queue.size(); ++i) {
+                auto state = queue[i];
+                longest_output[state] = std::max(longest_output[state], longest_output[failure[state]]);
+                for (long byte_class = 0; byte_class < class_count; ++byte_class) {
+                    auto &next = transitions[state * class_count + byte_class];
+                    auto fallback = transitions[failure[state] * class_count + byte_class];
+                    if (next == -1) {
+                        next = fallback;
+                    } else {
+                        failure[next] = fallback;
+                        queue.push_back(next);
+                    }
+                }
+            }
+        }
+
+        const char *find_automaton(const char *begin, const char *end) const {
+            // Occurrences are found by their end, so keep scanning while a longer literal could still start earlier
+            auto best = end;
+            long state = 0;
+            for (auto current = begin; current != end && (best == end || current - best < (long) max_length - 1);
+                 ++current) {
+                state = transitions[state * class_count + byte_classes[(unsigned char) *current]];
+                if (longest_output[state] > 0) {
+                    best = std::min(best, current + 1 - longest_output[state]);
+                }
+            }
+            return best;
+        }
+
+        Literals literals;
+        size_t max_length = 0;
+
+        std::array<long, 256> byte_classes{};
+        long class_count = 0;
+        std::vector<long> transitions;
+        std::vector<size_t> longest_output;
+    };
+
+    // Literals required by a regex: every match contains one of them
+    struct RequiredLiterals {
+        Literals literals;
+        // Every match starts with one of the literals
+        bool is_prefix;
+    };
+
+    std::optional<Literals> exact_literals(re::ast::AtomPointer root);
+
+    std::optional<Literals> concatenate_literals(const Literals &lhs, const Literals &rhs) {
+        if (lhs.size() * rhs.size() > max_literals) {
+            return std::nullopt;
+        }
+        Literals result;
+        for (auto &prefix: lhs) {
+            for (auto &suffix: rhs) {
+                result.push_back(prefix + suffix);
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    std::optional<Literals> union_literals(Literals lhs, const Literals &rhs) {
+        lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+        std::sort(lhs.begin(), lhs.end());
+        lhs.erase(std::unique(lhs.begin(), lhs.end()), lhs.end());
+        if (lhs.size() > max_literals) {
+            return std::nullopt;
+        }
+        return lhs;
+    }
+
+    // Every string matched by a single atom, when there are few enough of them
+    std::optional<Literals> exact_atom_literals(re::ast::AtomPointer atom) {
+        if (atom->type == re::ast::Type::Character) {
+            return Literals{std::string(1, ((re::ast::Character *) atom)->c)};
+        } else if (atom->type == re::ast::Type::Assertion) {
+            return Literals{""};
+        } else if (atom->type == re::ast::Type::Alternation) {
+            auto casted = (re::ast::Alternation *) atom;
+            auto lhs = exact_literals(casted->lhs);
+            auto rhs = exact_literals(casted->rhs);
+            if (lhs && rhs) {
+                return union_literals(*lhs, *rhs);
+            }
+        } else if (atom->type == re::ast::Type::Repetition) {
+            auto casted = (re::ast::Repetition *) atom;
+            auto inner = exact_literals(casted->inner);
+            if (inner && casted->type == re::ast::RepetitionType::ZeroOrOne) {
+                return union_literals(*inner, {""});
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<Literals> exact_literals(re::ast::AtomPointer root) {
+        Literals result{""};
+        for (; root; root = root->next) {
+            auto atom = exact_atom_literals(root);
+            if (!atom) {
+                return std::nullopt;
+            }
+            auto concatenated = concatenate_literals(result, *atom);
+            if (!concatenated) {
+                return std::nullopt;
+            }
+            result = *concatenated;
+        }
+        return result;
+    }
+
+    // Longer literals reject more lines; a prefix lets the engine skip straight to candidates
+    void keep_best(std::optional<RequiredLiterals> &best, const Literals &literals, bool is_prefix) {
+        auto min_length = [](const Literals &l) {
+            size_t result = l.front().size();
+            for (auto &literal: l) {
+                result = std::min(result, literal.size());
+            }
+            return result;
+        };
+
+        if (literals.empty() || min_length(literals) == 0) {
+            return;
+        }
+        if (best) {
+            auto length = min_length(literals);
+            auto best_length = min_length(best->literals);
+            if (length < best_length || (length == best_length && (best->is_prefix || !is_prefix))) {
+                return;
+            }
+        }
+        best = RequiredLiterals{literals, is_prefix};
+    }
+
+    std::optional<RequiredLiterals> required_literals(re::ast::AtomPointer root) {
+        std::optional<RequiredLiterals> best;
+
+        // Runs of consecutive atoms with exact literals concatenate into a required set
+        Literals run{""};
+        bool run_is_prefix = true;
+        for (; root; root = root->next) {
+            auto atom = exact_atom_literals(root);
+            auto concatenated = atom ? concatenate_literals(run, *atom) : std::nullopt;
+            if (concatenated) {
+                run = *concatenated;
+                continue;
+            }
+
+            keep_best(best, run, run_is_prefix);
+            run_is_prefix = false;
+            run = atom ? *atom : Literals{""};
+
+            // The body of a + is required too, though not exactly the whole match
+            if (root->type == re::ast::Type::Repetition) {
+                auto repetition = (re::ast::Repetition *) root;
+                auto inner = exact_literals(repetition->inner);
+                if (inner && repetition->type == re::ast::RepetitionType::OneOrMore) {
+                    keep_best(best, *inner, false);
+                }
+            }
+        }
+        keep_best(best, run, run_is_prefix);
+
+        return best;
+    }
+}
+
+#endif //REGEX_MATCHER_LITERALS_H
@@ -24,6 +24,26 @@ namespace {
                 c == '^' || c == '$');
     }
 
+    AtomPointer last_atom(AtomPointer p) {
+        while (p->next) {
+            p = p->next;
+        }
+        return p;
+    }
+
+    // Length of the UTF-8 sequence introduced by lead byte c, or 1 if c is not a valid multi-byte lead.
+    long utf8_sequence_length(char c) {
+        auto byte = (unsigned char) c;
+        if (byte >= 0xC2 && byte <= 0xDF) {
+            return 2;
+        } else if (byte >= 0xE0 && byte <= 0xEF) {
+            return 3;
+        } else if (byte >= 0xF0 && byte <= 0xF4) {
+            return 4;
+        }
+        return 1;
+    }
+
     bool consume_constant(char c, std::string::const_iterator &current, std::string::const_iterator end) {
         if (current != end && *current == c) {
             ++current;
@@ -66,8 +86,9 @@ namespace {
             auto backup_current = current;
             auto tail = parse_concatenation(current, end);
             if (tail.has_value()) {
+                // A group or a multi-byte character is a chain of atoms: append after its last one
                 Atom *unboxed = *ast;
-                unboxed->next = *tail;
+                last_atom(unboxed)->next = *tail;
             } else {
                 current = backup_current;
             }
@@ -121,8 +142,24 @@ namespace {
     std::optional<AtomPointer>
     parse_raw_character(std::string::const_iterator &current, std::string::const_iterator end) {
         if (current != end) {
+            // Multi-byte UTF-8 characters are kept together so that quantifiers apply to the whole sequence
+            auto length = utf8_sequence_length(*current);
+            auto sequence_end = current + 1;
+            for (; sequence_end != end && sequence_end - current < length; ++sequence_end) {
+                if (((unsigned char) *sequence_end & 0xC0) != 0x80) {
+                    break;
+                }
+            }
+            if (sequence_end - current != length) {
+                sequence_end = current + 1;
+            }
+
             auto ast = new Character{*current};
-            current++;
+            AtomPointer tail = ast;
+            for (++current; current != sequence_end; ++current) {
+                tail->next = new Character{*current};
+                tail = tail->next;
+            }
             return ast;
         } else {
             return std::nullopt;
@@ -1,7 +1,9 @@
+#include <chrono>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "interface.h"
 
@@ -21,16 +23,19 @@ void test_templated(const std::string& re, const std::string& s, bool expected,
     print_helper("/" + re + "/", "\"" + s + "\"", result == expected ? "Success!" : "Error!");
 }
 
-void test_full_match(const std::string &re, const std::string &s, bool expected) {
-    test_templated(re, s, expected, full_match);
+void test_full_match(const std::string &re, const std::string &s, bool expected,
+                     Encoding encoding = Encoding::Bytes) {
+    test_templated(re, s, expected, [=](auto& re, auto& s) { return full_match(re, s, encoding); });
 }
 
-void test_partial_match(const std::string &re, const std::string &s, bool expected) {
-    test_templated(re, s, expected, partial_match);
+void test_partial_match(const std::string &re, const std::string &s, bool expected,
+                        Encoding encoding = Encoding::Bytes) {
+    test_templated(re, s, expected, [=](auto& re, auto& s) { return partial_match(re, s, encoding); });
 }
 
 void print_usage() {
-    std::cout << "regex_matcher [--help | --tests | --match <re> | --bytecode <re> ]" << std::endl;
+    std::cout << "regex_matcher [--help | --tests | --benchmark | [--utf8] --match <re> | [--utf8] --bytecode <re> ]"
+              << std::endl;
 }
 
 void run_tests() {
@@ -70,10 +75,97 @@ void run_tests() {
     test_partial_match(".+b$", "aaaabc", false);
     test_partial_match("^abc$", "abc", true);
     test_partial_match("hello( world)?", "hello world!", true);
+    test_partial_match("(ab)c", "xabcx", true);
+    test_partial_match("(ab)c", "xacx", false);
+
+    std::cout << std::endl << "Literal prefilter" << std::endl;
+    print_helper("/Regex/", "Test string", "Test result");
+    test_partial_match("(timeout|refused|reset by peer|ECONNRESET).*", "read: connection reset by peer", true);
+    test_partial_match("(timeout|refused|reset by peer|ECONNRESET).*", "read: connection reset", false);
+    test_partial_match("(abcd|bc)d", "xxabcdd", true);
+    test_partial_match("(abcd|bc)d", "xxabcd", true);
+    test_partial_match("x(ab|cd)+y", "--xcdaby--", true);
+    test_partial_match("\\d+ (ms|s)", "took 15 ms", true);
+    test_partial_match("\\d+ (ms|s)", "took ms", false);
+    test_partial_match("ab", "x\nab", false);
+    test_full_match("(foo|bar)baz", "barbaz", true);
+    test_full_match("(foo|bar)baz", "bazbar", false);
+    test_partial_match("(a|b|c|d|e|f|g|h|i|j)(k|l)", "zzzzzzzzzzzzzzzzzzzzzjk", true);
+    test_partial_match("(aaaa|aab|bbbb|cc|dd|ee|ff|gg|hh)!", "aaab!", true);
+    test_partial_match("(aaaa|aab|bbbb|cc|dd|ee|ff|gg|hh)!", "aaaab", false);
+    test_partial_match("(alpha|beta|gamma|delta|epsilon|zeta|eta|theta|iota)$", "a zeta", true);
+
+    std::cout << std::endl << "UTF-8 matching" << std::endl;
+    print_helper("/Regex/", "Test string", "Test result");
+    test_full_match(".", "é", false);
+    test_full_match(".", "é", true, Encoding::Utf8);
+    test_full_match("...", "日本語", true, Encoding::Utf8);
+    test_full_match("..", "日本語", false, Encoding::Utf8);
+    test_full_match("a.b", "a😀b", true, Encoding::Utf8);
+    test_full_match("\\W", "€", true, Encoding::Utf8);
+    test_full_match("\\W\\W", "€", false, Encoding::Utf8);
+    test_full_match("\\w", "é", false, Encoding::Utf8);
+    test_full_match("é+", "ééé", true, Encoding::Utf8);
+    test_full_match("(ж|я)+", "жяж", true, Encoding::Utf8);
+    test_full_match(".", "\xC3", false, Encoding::Utf8);
+    test_full_match(".", "\xED\xA0\x80", false, Encoding::Utf8);
+    test_partial_match("^.$", "ü", true, Encoding::Utf8);
+    test_partial_match("d.t", "Ошибка: d€t", true, Encoding::Utf8);
+    test_partial_match("\\d\\D\\d", "1ñ2", true, Encoding::Utf8);
 }
 
-void match_stdin(const std::string& re) {
-    auto maybe_compiled = re::compile_partial(re);
+std::vector<std::string> make_corpus(bool mixed_script) {
+    std::vector<std::string> ascii_lines {
+        "2020-05-04 12:00:01 INFO connection established to 10.0.0.1",
+        "2020-05-04 12:00:02 WARN retrying request after timeout",
+        "2020-05-04 12:00:03 ERROR connection reset by peer",
+    };
+    std::vector<std::string> mixed_lines {
+        "2020-05-04 12:00:04 ERROR соединение сброшено: timeout",
+        "2020-05-04 12:00:05 INFO 接続が確立されました user=田中",
+        "2020-05-04 12:00:06 WARN Zeitüberschreitung bei Anfrage 😀",
+    };
+
+    std::vector<std::string> corpus;
+    for (int i = 0; i < 5000; ++i) {
+        corpus.push_back(ascii_lines[i % ascii_lines.size()]);
+        if (mixed_script) {
+            corpus.push_back(mixed_lines[i % mixed_lines.size()]);
+        }
+    }
+    return corpus;
+}
+
+void benchmark(const std::string& name, const std::string& re, const std::vector<std::string>& corpus,
+               Encoding encoding) {
+    auto compiled = *compile_partial(re, encoding);
+
+    auto start = std::chrono::steady_clock::now();
+    long matches = 0;
+    for (auto& line: corpus) {
+        matches += match(compiled, line);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+
+    print_helper(name, "/" + re + "/", std::to_string(elapsed) + " ms, " + std::to_string(matches) + " hits");
+}
+
+void run_benchmarks() {
+    auto ascii = make_corpus(false);
+    auto mixed = make_corpus(true);
+
+    print_helper("Corpus", "/Regex/", "Result");
+    for (auto re: {"ERROR.*timeout", "(timeout|refused|reset by peer|ECONNRESET).*", "user=\\W+", "\\d+:\\d+ \\w+ .*\\W$"}) {
+        benchmark("ascii, bytes", re, ascii, Encoding::Bytes);
+        benchmark("ascii, utf8", re, ascii, Encoding::Utf8);
+        benchmark("mixed, bytes", re, mixed, Encoding::Bytes);
+        benchmark("mixed, utf8", re, mixed, Encoding::Utf8);
+    }
+}
+
+void match_stdin(const std::string& re, Encoding encoding) {
+    auto maybe_compiled = re::compile_partial(re, encoding);
 
     if (maybe_compiled) {
         auto compiled = *maybe_compiled;
@@ -87,8 +179,8 @@ void match_stdin(const std::string& re) {
     }
 }
 
-void print_bytecode(const std::string& re) {
-    auto maybe_compiled = re::compile_partial(re);
+void print_bytecode(const std::string& re, Encoding encoding) {
+    auto maybe_compiled = re::compile_partial(re, encoding);
 
     if (maybe_compiled) {
         auto compiled = *maybe_compiled;
@@ -100,15 +192,23 @@ void print_bytecode(const std::string& re) {
 
 
 int main(int argc, char *argv[]) {
+    auto encoding = Encoding::Bytes;
+    if (argc > 1 && strcmp(argv[1], "--utf8") == 0) {
+        encoding = Encoding::Utf8;
+        --argc;
+        ++argv;
+    }
 
     if (argc == 2 && strcmp(argv[1], "--tests") == 0) {
         run_tests();
+    } else if (argc == 2 && strcmp(argv[1], "--benchmark") == 0) {
+        run_benchmarks();
     } else if (argc == 3 && strcmp(argv[1], "--match") == 0) {
         std::string re {argv[2]};
-        match_stdin(re);
+        match_stdin(re, encoding);
     } else if (argc == 3 && strcmp(argv[1], "--bytecode") == 0) {
         std::string re {argv[2]};
-        print_bytecode(re);
+        print_bytecode(re, encoding);
     } else {
         print_usage();
     }
@@ -2,12 +2,21 @@
 #define REGEX_MATCHER_VM2_H
 
 #include <bitset>
+#include <cstring>
 #include <list>
+#include <memory>
 #include <ostream>
 #include <variant>
 #include <vector>
 
 #include "ast.h"
+#include "literals.h"
+
+namespace re {
+    enum class Encoding {
+        Bytes, Utf8
+    };
+}
 
 namespace {
     template<typename T>
@@ -84,16 +93,17 @@ namespace {
     public:
         Bitset() = default;
 
-        void set(char c) { mask.set((size_t) c); }
+        void set(unsigned char c) { mask.set(c); }
         void flip() { mask.flip(); };
-        bool match(char other) const { return mask[(size_t) other]; };
+        bool match(char other) const { return mask[(unsigned char) other]; };
         Bitset operator~() { return Bitset(~mask); };
         Bitset operator|(const Bitset &other) { return Bitset(mask | other.mask); }
+        Bitset operator&(const Bitset &other) { return Bitset(mask & other.mask); }
         friend std::ostream& operator<<(std::ostream& os, Bitset inst) { os << "Bitset(...)"; return os; };
 
     private:
-        Bitset(std::bitset<255> mask_) : mask{mask_} {};
-        std::bitset<255> mask;
+        Bitset(std::bitset<256> mask_) : mask{mask_} {};
+        std::bitset<256> mask;
     };
 
     class Split {
@@ -118,25 +128,99 @@ namespace {
         long target;
     };
 
+    // Guards the multi-byte branch of a UTF-8 class: fails straight away when the subject is pure ASCII
+    class NonAscii {
+        friend std::ostream& operator<<(std::ostream& os, NonAscii inst) { os << "NonAscii()"; return os; };
+    };
+
+    // Fails unless one of the required literals occurs in the rest of the subject. When seeking, it also skips
+    // ahead to the next occurrence, as long as the partial match loop could have got there (no newline crossed).
+    class Search {
+    public:
+        Search(std::shared_ptr<const LiteralSearcher> searcher_, bool seek_) : searcher{std::move(searcher_)},
+                                                                               seek{seek_} {};
+
+        std::optional<long> find(Range<std::string> view) const {
+            if (view.empty()) {
+                return std::nullopt;
+            }
+            auto begin = &view;
+            auto end = begin + (view.end - view.counter);
+            auto found = searcher->find(begin, end);
+            if (found == end || (seek && std::memchr(begin, '\n', found - begin))) {
+                return std::nullopt;
+            }
+            return found - begin;
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const Search& inst) {
+            os << "Search(" << (inst.seek ? "seek, " : "");
+            auto &literals = inst.searcher->get_literals();
+            for (size_t i = 0; i < literals.size(); ++i) {
+                os << (i ? "|" : "") << literals[i];
+            }
+            os << ")";
+            return os;
+        };
+
+        std::shared_ptr<const LiteralSearcher> searcher;
+        bool seek;
+    };
+
     class Match {
         friend std::ostream& operator<<(std::ostream& os, Match inst) { os << "Match()"; return os; };
     };
 
-    Bitset make_range(char start, char end) {
+    Bitset make_range(unsigned char start, unsigned char end) {
         Bitset b;
-        for (char c = start; c <= end; ++c) {
+        for (int c = start; c <= end; ++c) {
             b.set(c);
         }
         return b;
     }
 
-    using Instruction = std::variant<Assertion, Character, Bitset, Split, Jump, Match>;
+    using Instruction = std::variant<Assertion, Character, Bitset, Split, Jump, NonAscii, Search, Match>;
     using re::ast::AtomPointer;
 
-    std::list<Instruction> compile_fragment(AtomPointer root);
-    std::list<Instruction> compile_atom(AtomPointer root);
+    std::list<Instruction> compile_fragment(AtomPointer root, re::Encoding encoding);
+    std::list<Instruction> compile_atom(AtomPointer root, re::Encoding encoding);
+
+    std::list<Instruction> make_alternation(std::list<Instruction> lhs, std::list<Instruction> rhs) {
+        std::list<Instruction> code;
+
+        code.emplace_back(Split(1, lhs.size() + 2));
+        auto rhs_size = rhs.size();
+        code.splice(code.end(), lhs);
+        code.emplace_back(Jump(rhs_size + 1));
+        code.splice(code.end(), rhs);
+
+        return code;
+    }
 
-    std::list<Instruction> compile_atom(AtomPointer root) {
+    // Every well-formed multi-byte UTF-8 sequence, as byte-level alternatives (see RFC 3629, section 4)
+    std::list<Instruction> make_utf8_multibyte() {
+        auto tail = make_range(0x80, 0xBF);
+        std::vector<std::list<Instruction>> sequences {
+            {make_range(0xC2, 0xDF), tail},
+            {make_range(0xE0, 0xE0), make_range(0xA0, 0xBF), tail},
+            {make_range(0xE1, 0xEC), tail, tail},
+            {make_range(0xED, 0xED), make_range(0x80, 0x9F), tail},
+            {make_range(0xEE, 0xEF), tail, tail},
+            {make_range(0xF0, 0xF0), make_range(0x90, 0xBF), tail, tail},
+            {make_range(0xF1, 0xF3), tail, tail, tail},
+            {make_range(0xF4, 0xF4), make_range(0x80, 0x8F), tail, tail},
+        };
+
+        auto code = sequences.back();
+        sequences.pop_back();
+        for (; !sequences.empty(); sequences.pop_back()) {
+            code = make_alternation(sequences.back(), code);
+        }
+        code.push_front(NonAscii {});
+        return code;
+    }
+
+    std::list<Instruction> compile_atom(AtomPointer root, re::Encoding encoding) {
         if (root->type == re::ast::Type::Character) {
             auto atom = (re::ast::Character *) root;
             return {Character(atom->c)};
@@ -155,20 +239,21 @@ namespace {
             }
             inst = atom->negate ? ~inst : inst;
 
+            // Classes only name ASCII characters, so anything matching a non-ASCII code point is a whole sequence
+            bool matches_non_ascii = atom->negate || atom->char_class_type == re::ast::CharacterClassType::All;
+            if (encoding == re::Encoding::Utf8 && matches_non_ascii) {
+                inst = inst & make_range(0x00, 0x7F);
+                return make_alternation({inst}, make_utf8_multibyte());
+            }
+
             return {inst};
         } else if (root->type == re::ast::Type::Alternation) {
             auto atom = (re::ast::Alternation *) root;
-            std::list<Instruction> code;
-
-            auto lhs = compile_fragment(atom->lhs);
-            auto rhs = compile_fragment(atom->rhs);
 
-            code.emplace_back(Split(1, lhs.size() + 2));
-            code.splice(code.end(), lhs);
-            code.emplace_back(Jump(rhs.size() + 1));
-            code.splice(code.end(), rhs);
+            auto lhs = compile_fragment(atom->lhs, encoding);
+            auto rhs = compile_fragment(atom->rhs, encoding);
 
-            return code;
+            return make_alternation(lhs, rhs);
         } else if (root->type == re::ast::Type::Assertion) {
             auto atom = (re::ast::Assertion*) root;
             return {Assertion {atom->assertion_type}};
@@ -177,11 +262,11 @@ namespace {
             auto code = std::list<Instruction>{};
 
             if (atom->type == re::ast::RepetitionType::ZeroOrOne) {
-                auto inner = compile_fragment(atom->inner);
+                auto inner = compile_fragment(atom->inner, encoding);
                 code.emplace_back(Split(1, inner.size() + 1));
                 code.splice(code.end(), inner);
             } else if (atom->type == re::ast::RepetitionType::ZeroOrMore) {
-                auto inner = compile_fragment(atom->inner);
+                auto inner = compile_fragment(atom->inner, encoding);
                 auto inner_size = inner.size();
 
                 code.emplace_back(Split(1, inner_size + 2));
@@ -189,7 +274,7 @@ namespace {
                 code.emplace_back(Jump(-inner_size - 1));
 
             } else if (atom->type == re::ast::RepetitionType::OneOrMore) {
-                auto inner = compile_fragment(atom->inner);
+                auto inner = compile_fragment(atom->inner, encoding);
                 auto inner_size = inner.size();
 
                 code.splice(code.end(), inner);
@@ -201,16 +286,26 @@ namespace {
         }
     }
 
-    std::list<Instruction> compile_fragment(AtomPointer root) {
+    std::list<Instruction> compile_fragment(AtomPointer root, re::Encoding encoding) {
         std::list<Instruction> code{};
         for (; root; root = root->next) {
-            auto fragment = compile_atom(root);
+            auto fragment = compile_atom(root, encoding);
             code.splice(code.end(), fragment);
         }
         return code;
     }
 
-    bool match_fragment(Range<std::vector<Instruction>> program_counter, Range<std::string> data_counter) {
+    bool is_ascii(const std::string& s) {
+        for (auto c: s) {
+            if ((unsigned char) c >= 0x80) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool match_fragment(Range<std::vector<Instruction>> program_counter, Range<std::string> data_counter,
+                        bool ascii_only) {
         while (!program_counter.empty()) {
             if (auto inst = std::get_if<Character>(&program_counter)) {
                 if (!data_counter.empty() && inst->match(*data_counter)) {
@@ -227,9 +322,9 @@ namespace {
                     return false;
                 }
             } else if (auto inst = std::get_if<Split>(&program_counter)) {
-                bool result = match_fragment(program_counter + inst->lhs, data_counter);
+                bool result = match_fragment(program_counter + inst->lhs, data_counter, ascii_only);
                 if (!result) {
-                    result = match_fragment(program_counter + inst->rhs, data_counter);
+                    result = match_fragment(program_counter + inst->rhs, data_counter, ascii_only);
                 }
                 return result;
             } else if (auto inst = std::get_if<Assertion>(&program_counter)) {
@@ -240,6 +335,20 @@ namespace {
                 }
             } else if (auto inst = std::get_if<Jump>(&program_counter)) {
                 program_counter = program_counter + inst->target;
+            } else if (auto inst = std::get_if<Search>(&program_counter)) {
+                auto offset = inst->find(data_counter);
+                if (!offset) {
+                    return false;
+                }
+                if (inst->seek) {
+                    data_counter = data_counter + *offset;
+                }
+                ++program_counter;
+            } else if (auto inst = std::get_if<NonAscii>(&program_counter)) {
+                if (ascii_only) {
+                    return false;
+                }
+                ++program_counter;
             } else if (auto inst = std::get_if<Match>(&program_counter)) {
                 return true;
             } else {
@@ -253,21 +362,31 @@ namespace {
 namespace re {
     void print_bytecode(const std::vector<Instruction>& compiled) {
         for (auto& inst: compiled) {
-            std::visit([](auto x) {std::cout << x << std::endl; } , inst);
+            std::visit([](auto& x) {std::cout << x << std::endl; } , inst);
         }
     }
 
-    std::optional<std::vector<Instruction>> compile_partial(const std::string& re) {
+    std::optional<std::vector<Instruction>> compile_partial(const std::string& re, Encoding encoding = Encoding::Bytes) {
         auto maybe_ast = parse(re);
         if (maybe_ast) {
             auto ast = *maybe_ast;
 
-            auto compiled = compile_fragment(ast);
+            auto compiled = compile_fragment(ast, encoding);
+            auto literals = required_literals(ast);
 
             // push_front works in reverse order
-            compiled.push_front(Jump {-2});
-            compiled.push_front(~make_range('\n', '\n'));
-            compiled.push_front(Split {3, 1});
+            if (literals) {
+                // When the literals start every match, each attempt seeks to the next candidate position first
+                auto searcher = std::make_shared<const LiteralSearcher>(literals->literals);
+                compiled.push_front(Jump {literals->is_prefix ? -3 : -2});
+                compiled.push_front(~make_range('\n', '\n'));
+                compiled.push_front(Split {3, 1});
+                compiled.push_front(::Search {searcher, literals->is_prefix});
+            } else {
+                compiled.push_front(Jump {-2});
+                compiled.push_front(~make_range('\n', '\n'));
+                compiled.push_front(Split {3, 1});
+            }
 
             compiled.push_back(Match {});
 
@@ -279,12 +398,16 @@ namespace re {
         }
     }
 
-    std::optional<std::vector<Instruction>> compile_full(const std::string& re) {
+    std::optional<std::vector<Instruction>> compile_full(const std::string& re, Encoding encoding = Encoding::Bytes) {
         auto maybe_ast = parse(re);
         if (maybe_ast) {
             auto ast = *maybe_ast;
 
-            auto compiled = compile_fragment(ast);
+            auto compiled = compile_fragment(ast, encoding);
+            if (auto literals = required_literals(ast)) {
+                auto searcher = std::make_shared<const LiteralSearcher>(literals->literals);
+                compiled.push_front(::Search {searcher, false});
+            }
             compiled.push_back(::Assertion {re::ast::AssertionType::EndOfString});
             compiled.push_back(Match {});
 
@@ -300,11 +423,11 @@ namespace re {
         auto re_range = Range(re);
         auto s_range = Range(s);
 
-        return match_fragment(re_range, s_range);
+        return match_fragment(re_range, s_range, is_ascii(s));
     }
 
-    bool full_match(const std::string& re, const std::string& s) {
-        auto maybe_compiled = compile_full(re);
+    bool full_match(const std::string& re, const std::string& s, Encoding encoding = Encoding::Bytes) {
+        auto maybe_compiled = compile_full(re, encoding);
         if (maybe_compiled) {
             auto compiled = *maybe_compiled;
             return match(compiled, s);
@@ -313,8 +436,8 @@ namespace re {
         }
     }
 
-    bool partial_match(const std::string& re, const std::string& s) {
-        auto maybe_compiled = compile_partial(re);
+    bool partial_match(const std::string& re, const std::string& s, Encoding encoding = Encoding::Bytes) {
+        auto maybe_compiled = compile_partial(re, encoding);
         if (maybe_compiled) {
             auto compiled = *maybe_compiled;
             return match(compiled, s);